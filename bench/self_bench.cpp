@@ -0,0 +1,305 @@
+// Measures the framework's own overhead.
+//
+//   g++ -std=c++11 -O2 bench/self_bench.cpp -o self_bench
+//   ./self_bench [--max-scale=N] [--repeats=N] [--baseline=FILE] [--tolerance=FRACTION]
+//
+// Each result is the median of --repeats runs (default 7), printed as one
+// JSON object per line together with its spread, the standard deviation of
+// a single run relative to the median, estimated from the median absolute
+// deviation. The runs are interleaved, every benchmark once per round, so a
+// machine that slows down for a while widens the spreads instead of
+// shifting a few results:
+//   {"bench":"check_pass_int","n":1000,"total_ns":123456,"ns_per_op":123.456,"spread":0.012}
+// Test output is discarded while measuring, so the numbers include
+// formatting but not terminal I/O.
+//
+// With --baseline, results are compared against the output of an earlier
+// run; a result slower per op than the baseline by more than the tolerance
+// (default 0.1), or by more than twice the combined spread of both runs
+// when that is larger, is a regression and the exit code is 1. Results
+// measured over less than 1ms are too noisy to hold and only reported.
+
+#include "../test.h"
+
+#include <functional>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+namespace
+{
+  class NullBuffer : public std::streambuf
+  {
+  protected:
+    int overflow(int c) { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) { return n; }
+  };
+
+  class BenchCase : public tester::TestCase
+  {
+  public:
+    BenchCase(std::function<void(long)> body, long n):
+      TestCase("bench", __FILE__, __LINE__), first_pass_ns(-1), body(body), n(n) { }
+
+    long long first_pass_ns;
+
+  private:
+    void _run()
+    {
+      tester::TimeTester timer("pass");
+      timer.start();
+      body(n);
+      timer.stop();
+      if (first_pass_ns < 0)
+        first_pass_ns = timer.get_diff_ns();
+    }
+
+    std::function<void(long)> body;
+    long n;
+  };
+
+  NullBuffer null_buffer;
+  std::streambuf *cout_buffer, *cerr_buffer;
+
+  void mute()
+  {
+    cout_buffer = std::cout.rdbuf(&null_buffer);
+    cerr_buffer = std::cerr.rdbuf(&null_buffer);
+  }
+
+  void unmute()
+  {
+    std::cout.rdbuf(cout_buffer);
+    std::cerr.rdbuf(cerr_buffer);
+  }
+
+  const long long min_held_ns = 1000000;
+  const double spread_margin = 2;
+
+  struct Sample
+  {
+    long long total_ns;
+    double spread;
+  };
+
+  struct Held
+  {
+    double ns_per_op;
+    double spread;
+  };
+
+  int repeats = 7;
+  std::map<std::pair<std::string, long>, Held> baseline;
+  double tolerance = 0.1;
+  int regressions = 0;
+
+  // value following "key": in one line of our own JSON output
+  std::string json_field(const std::string &line, const std::string &key)
+  {
+    std::string tag = "\"" + key + "\":";
+    size_t pos = line.find(tag);
+    if (pos == std::string::npos)
+      return "";
+    pos += tag.length();
+    if (line[pos] == '"')
+      return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+    return line.substr(pos, line.find_first_of(",}", pos) - pos);
+  }
+
+  bool load_baseline(const std::string &path)
+  {
+    std::ifstream in(path);
+    if (!in)
+      return false;
+    std::string line;
+    while (std::getline(in, line))
+    {
+      std::string bench = json_field(line, "bench");
+      std::string n = json_field(line, "n");
+      std::string ns_per_op = json_field(line, "ns_per_op");
+      std::string spread = json_field(line, "spread");
+      if (!bench.empty() && !n.empty() && !ns_per_op.empty())
+      {
+        // baselines from before spreads were recorded only get the tolerance
+        Held held = { std::atof(ns_per_op.c_str()), spread.empty() ? 0 : std::atof(spread.c_str()) };
+        baseline[std::make_pair(bench, std::atol(n.c_str()))] = held;
+      }
+    }
+    return true;
+  }
+
+  void report(const std::string &bench, long n, Sample sample)
+  {
+    double ns_per_op = double(sample.total_ns) / n;
+    std::cout << "{\"bench\":\"" << bench << "\",\"n\":" << n
+      << ",\"total_ns\":" << sample.total_ns
+      << ",\"ns_per_op\":" << std::fixed << std::setprecision(3) << ns_per_op
+      << ",\"spread\":" << sample.spread;
+
+    auto it = baseline.find(std::make_pair(bench, n));
+    if (it != baseline.end())
+    {
+      // whole runs drift apart by about as much as single runs within one,
+      // so the spreads are used as they are rather than as a median's error
+      double spread = std::sqrt(sample.spread * sample.spread + it->second.spread * it->second.spread);
+      double margin = std::max(tolerance, spread_margin * spread);
+      bool regressed = sample.total_ns >= min_held_ns && ns_per_op > it->second.ns_per_op * (1 + margin);
+      regressions += regressed;
+      std::cout << ",\"baseline_ns_per_op\":" << it->second.ns_per_op
+        << ",\"regressed\":" << std::boolalpha << regressed;
+    }
+    std::cout << "}" << std::endl;
+  }
+
+  bool parse_number(const char *str, double &res)
+  {
+    char *end;
+    res = std::strtod(str, &end);
+    return end != str && *end == '\0';
+  }
+
+  // runs body(n) as the only pass of a test case, so CHECKs have a current case
+  long long time_in_case(std::function<void(long)> body, long n)
+  {
+    BenchCase tc(body, n);
+    mute();
+    tc.run();
+    unmute();
+    return tc.first_pass_ns;
+  }
+
+  // for normally distributed samples the standard deviation is 1.4826 MADs
+  Sample summarize(const std::vector<long long> &samples)
+  {
+    long long median = tester::median_ns(samples);
+    std::vector<long long> deviations;
+    for (auto ns : samples)
+      deviations.push_back(std::llabs(ns - median));
+    Sample res = { median, median ? 1.4826 * tester::median_ns(deviations) / median : 0 };
+    return res;
+  }
+
+  struct Bench
+  {
+    std::string name;
+    long n;
+    std::function<long long()> measure;
+    std::vector<long long> samples;
+  };
+
+  std::vector<Bench> benches;
+
+  void add_bench(const std::string &name, long n, std::function<long long()> measure)
+  {
+    Bench bench = { name, n, measure, std::vector<long long>() };
+    benches.push_back(bench);
+  }
+
+  void run_benches()
+  {
+    for (int i = 0; i < repeats; ++i)
+      for (auto &bench : benches)
+        bench.samples.push_back(bench.measure());
+    for (auto &bench : benches)
+      report(bench.name, bench.n, summarize(bench.samples));
+  }
+
+  void bench_checks(const std::string &bench, std::function<void(long)> body, long max_scale)
+  {
+    for (long n = 1; n <= max_scale; n *= 10)
+      add_bench(bench, n, [=]() { return time_in_case(body, n); });
+  }
+}
+
+int main(int argc, char **argv)
+{
+  long max_scale = 1000000;
+  std::string baseline_path;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    double value;
+    if (arg.compare(0, 12, "--max-scale=") == 0 && parse_number(arg.c_str() + 12, value) && value >= 1)
+      max_scale = long(value);
+    else if (arg.compare(0, 12, "--tolerance=") == 0 && parse_number(arg.c_str() + 12, value) && value >= 0)
+      tolerance = value;
+    else if (arg.compare(0, 10, "--repeats=") == 0 && parse_number(arg.c_str() + 10, value) && value >= 1)
+      repeats = int(value);
+    else if (arg.compare(0, 11, "--baseline=") == 0)
+      baseline_path = arg.substr(11);
+    else
+    {
+      std::cerr << "Invalid option \"" << arg << "\"" << std::endl;
+      return 1;
+    }
+  }
+  if (!baseline_path.empty() && !load_baseline(baseline_path))
+  {
+    std::cerr << "Cannot read baseline \"" << baseline_path << "\"" << std::endl;
+    return 1;
+  }
+
+  std::string str_a(32, 'a'), str_b(32, 'b');
+  std::vector<int> vec_a(16, 1), vec_b(16, 2);
+
+  bench_checks("check_pass_int", [](long n) { for (long i = 0; i < n; ++i) { CHECK(i == i); } }, max_scale);
+  bench_checks("check_fail_int", [](long n) { for (long i = 0; i < n; ++i) { CHECK(i == i + 1); } }, max_scale);
+  bench_checks("check_pass_string", [&](long n) { for (long i = 0; i < n; ++i) { CHECK(str_a == str_a); } }, max_scale);
+  bench_checks("check_fail_string", [&](long n) { for (long i = 0; i < n; ++i) { CHECK(str_a == str_b); } }, max_scale);
+  bench_checks("check_pass_container", [&](long n) { for (long i = 0; i < n; ++i) { CHECK(vec_a == vec_a); } }, max_scale);
+  bench_checks("check_fail_container", [&](long n) { for (long i = 0; i < n; ++i) { CHECK(vec_a == vec_b); } }, max_scale);
+  bench_checks("almost_equal_pass", [](long n) { for (long i = 0; i < n; ++i) { CHECK(tester::almost_equal(1.0f, 1.0f)); } }, max_scale);
+  bench_checks("almost_equal_fail", [](long n) { for (long i = 0; i < n; ++i) { CHECK(tester::almost_equal(1.0f, 2.0f)); } }, max_scale);
+  bench_checks("timer_start_stop", [](long n) {
+      for (long i = 0; i < n; ++i)
+      {
+        START_TIMER("bench");
+        STOP_TIMER("bench");
+      }
+    }, max_scale);
+
+  // every subcase forces another pass of the case, so the rerun cost is
+  // quadratic in the number of subcases; keep the scale bounded
+  long max_subcases = std::min(max_scale, 1000L);
+  auto subcases = [](long n) {
+    for (long i = 0; i < n; ++i)
+      TEST_SUBCASE("") { CHECK(i == i); }
+  };
+  for (long n = 1; n <= max_subcases; n *= 10)
+  {
+    add_bench("subcase_construct", n, [=]() { return time_in_case(subcases, n); });
+    add_bench("subcase_rerun", n, [=]() {
+        BenchCase tc(subcases, n);
+        tester::TimeTester timer("subcases");
+        mute();
+        timer.start();
+        tc.run();
+        timer.stop();
+        unmute();
+        return timer.get_diff_ns();
+      });
+  }
+
+  // every scale starts from an empty registry, and nothing is left pointing
+  // at the case once it goes out of scope
+  for (long n = 1; n <= max_scale; n *= 10)
+  {
+    add_bench("register_test_case", n, [=]() {
+        BenchCase tc([](long) { }, 0);
+        tester::TimeTester timer("register");
+        tester::TestMonitor::clear_test_cases();
+        timer.start();
+        for (long i = 0; i < n; ++i)
+          tester::TestMonitor::register_test_case(&tc);
+        timer.stop();
+        tester::TestMonitor::clear_test_cases();
+        return timer.get_diff_ns();
+      });
+  }
+
+  run_benches();
+
+  if (!baseline.empty())
+    std::cerr << regressions << " regression(s) against " << baseline_path << std::endl;
+  return regressions ? 1 : 0;
+}
@@ -13,10 +13,33 @@
 #include <cmath>
 #include <vector>
 #include <float.h>
+#include <stdint.h>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TESTER_X86
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 
 #define WIDTH TERM
 #define TESTER_MAX_ULPS 2
 #define FLOAT_PRINT_PRECISION 9
+#define TESTER_TIME_REPEATS 11
+#define TESTER_COMPLEXITY_MAX_RMS 0.25
 
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Woverloaded-shift-op-parentheses"
@@ -38,6 +61,22 @@ namespace tester
 
   std::string prefix;
 
+  // index of the data record being checked by this thread, -1 outside TEST_CASE_DATA
+  thread_local long long current_record = -1;
+
+  // Serializes check output while data test chunks run on several threads
+  std::mutex output_mutex;
+  bool parallel_output = false;
+
+  class OutputLock
+  {
+  public:
+    OutputLock(): lock(output_mutex, std::defer_lock) { if (parallel_output) lock.lock(); }
+
+  private:
+    std::unique_lock<std::mutex> lock;
+  };
+
 #if WIDTH == TERM
 
 #include <sys/ioctl.h>
@@ -58,6 +97,8 @@ namespace tester
 #endif
 
   const int _FLOAT_PRECISION = FLOAT_PRINT_PRECISION + 1;
+  const int _TIME_REPEATS = TESTER_TIME_REPEATS;
+  const double _COMPLEXITY_MAX_RMS = TESTER_COMPLEXITY_MAX_RMS;
 
   // ----------------------------------------
   // Evaluer class
@@ -165,6 +206,119 @@ namespace tester
       Evaluer& evaluer;
     };
 
+  // }}}
+  // ----------------------------------------
+  // TraceRecorder class
+  // ----------------------------------------
+  // {{{
+
+  // Buffers Chrome trace events in memory, written once by run_rests
+  class TraceRecorder
+  {
+  public:
+    static bool enabled() { return !file.empty(); }
+    static void enable(std::string path) { file = path; }
+
+    static double now_us();
+    static void complete(std::string name, const char *cat, double begin_us);
+    static void instant(std::string name, const char *cat, std::string detail);
+    static void write();
+
+  private:
+    struct Event
+    {
+      std::string name, detail;
+      const char *cat;
+      char ph;
+      double ts, dur;
+      int tid;
+    };
+
+    static int thread_id();
+    static std::string escape(const std::string &str);
+
+    static std::string file;
+    static std::vector<Event> events;
+    static std::mutex mutex;
+  };
+
+  std::string TraceRecorder::file;
+  std::vector<TraceRecorder::Event> TraceRecorder::events;
+  std::mutex TraceRecorder::mutex;
+
+  double TraceRecorder::now_us()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+  }
+
+  int TraceRecorder::thread_id()
+  {
+    static std::atomic<int> next_id(1);
+    static thread_local int id = next_id++;
+    return id;
+  }
+
+  void TraceRecorder::complete(std::string name, const char *cat, double begin_us)
+  {
+    double end_us = now_us();
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back(Event{name, "", cat, 'X', begin_us, end_us - begin_us, thread_id()});
+  }
+
+  void TraceRecorder::instant(std::string name, const char *cat, std::string detail)
+  {
+    double ts = now_us();
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back(Event{name, detail, cat, 'i', ts, 0, thread_id()});
+  }
+
+  std::string TraceRecorder::escape(const std::string &str)
+  {
+    std::ostringstream ss;
+    for (char c : str)
+    {
+      if (c == '"' || c == '\\')
+        ss << '\\' << c;
+      else if ((unsigned char)c < 0x20)
+        ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+      else
+        ss << c;
+    }
+    return ss.str();
+  }
+
+  void TraceRecorder::write()
+  {
+    if (!enabled())
+      return;
+    std::ofstream out(file);
+    if (!out)
+    {
+      std::cerr << "Cannot open trace file \"" << file << "\"" << std::endl;
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const Event &e = events[i];
+      out << (i ? ",\n" : "\n")
+        << "{\"name\":\"" << escape(e.name) << "\",\"cat\":\"" << e.cat
+        << "\",\"ph\":\"" << e.ph << "\",\"ts\":" << e.ts
+        << ",\"pid\":1,\"tid\":" << e.tid;
+      if (e.ph == 'X')
+        out << ",\"dur\":" << e.dur;
+      else
+        out << ",\"s\":\"t\",\"args\":{\"at\":\"" << escape(e.detail) << "\"}";
+      out << "}";
+    }
+    out << "\n]}" << std::endl;
+  }
+
   // }}}
   // ----------------------------------------
   // TestMonitor class
@@ -176,14 +330,34 @@ namespace tester
   class TestMonitor {
   public:
     static void register_test_case(TestCase *ptc);
+    static void clear_test_cases();
+    static bool parse_args(int argc, char **argv);
+    static bool update_golden_files() { return update_golden; }
 
     static bool any_test_failed();
     static void test_case_result(bool passed);
     static void run_rests();
 
   private:
+    struct CaseState
+    {
+      bool passed;
+      long long duration_ns;
+    };
+
+    static void assign_state_ids();
+    static void load_state();
+    static void save_state();
+    static std::vector<TestCase*> select_test_cases();
+
     static int overally_failed;
     static int overally_run;
+    static bool update_golden;
+    static bool failed_first, only_failed;
+    static double time_budget;
+    static std::string state_path;
+    static std::map<std::string, CaseState> state;
+    static std::map<const TestCase*, std::string> state_ids;
     static std::vector<TestCase*> test_cases;
   };
 
@@ -199,18 +373,22 @@ namespace tester
     static TestCase *get_current() { return current; }
 
     bool run();
+    std::string get_id() const { return file + " " + name; }
     void add_check(bool passed) { this->failed += !passed; this->passed += passed; }
     bool add_subcase();
 
   protected:
     TestCase(std::string name, std::string file, int line);
 
+    std::string get_file() const { return file; }
+    int get_line() const { return line; }
+
   private:
     static TestCase *current;
 
     std::string name, file;
     int line;
-    int failed, passed;
+    std::atomic<int> failed, passed;
     int subcases;
     int subcases_done;
     int rerun;
@@ -222,6 +400,8 @@ namespace tester
 
   bool TestCase::run()
   {
+    double trace_begin = TraceRecorder::enabled() ? TraceRecorder::now_us() : 0;
+
     std::cout << prefix << name << " - case starting";
     std::cout << std::endl;
     prefix += "    ";
@@ -255,6 +435,9 @@ namespace tester
 
     current = nullptr;
 
+    if (TraceRecorder::enabled())
+      TraceRecorder::complete(name, "case", trace_begin);
+
     return failed == 0;
   }
 
@@ -300,6 +483,7 @@ namespace tester
     int line;
     int failed;
     bool should_run;
+    double trace_begin;
   };
 
   TestSubcase* TestSubcase::current = nullptr;
@@ -311,6 +495,8 @@ namespace tester
     current = this;
     if (should_run && name.length() > 0)
     {
+      if (TraceRecorder::enabled())
+        trace_begin = TraceRecorder::now_us();
       std::cout << prefix << name << " - subcase";
       std::cout << std::endl;
       prefix += "    ";
@@ -332,6 +518,9 @@ namespace tester
         suff << "  subcase FAILED";
       }
       std::cerr << pref.str() << std::string(std::max(_WIDTH - signed(pref.str().length()) - signed(suff.str().length()), 3), '.') << suff.str() << std::endl;
+
+      if (TraceRecorder::enabled())
+        TraceRecorder::complete(name, "subcase", trace_begin);
     }
     current = nullptr;
   }
@@ -409,9 +598,23 @@ namespace tester
     if (auto *subcase = TestSubcase::get_current())
       subcase->add_check(passed);
 
+    if (!passed && TraceRecorder::enabled())
+    {
+      std::ostringstream at;
+      at << evaluer.get_fname() << ":" << evaluer.get_line_no();
+      if (current_record >= 0)
+        at << " record " << current_record;
+      TraceRecorder::instant("CHECK(" + evaluer.get_expr() + ")", "check", at.str());
+    }
+
     std::ostringstream pref, suff;
     if (!passed)
-      out << prefix << "at " << evaluer.get_fname() << ":" << evaluer.get_line_no() << ":" << std::endl;
+    {
+      out << prefix << "at " << evaluer.get_fname() << ":" << evaluer.get_line_no();
+      if (current_record >= 0)
+        out << " ( record " << current_record << " )";
+      out << ":" << std::endl;
+    }
     pref << prefix << "CHECK(" << evaluer.get_expr()  << ")  ";
     suff << (passed ? "  passed" : "  FAILED");
     int fillLen = std::max(_WIDTH - signed(pref.str().length()) - signed(suff.str().length()), 3);
@@ -423,6 +626,7 @@ namespace tester
   template <typename V>
     void LeftValue<U>::assert (bool val, std::string op, V right_value)
     {
+      OutputLock lock;
       int prec = std::cout.precision();
       std::cout.precision(_FLOAT_PRECISION);
 
@@ -465,6 +669,7 @@ namespace tester
 
   void LeftValue<bool>::assert (bool val)
   {
+    OutputLock lock;
     int prec = std::cout.precision();
     std::cout.precision(_FLOAT_PRECISION);
 
@@ -477,6 +682,7 @@ namespace tester
 
   void LeftValue<AlmostEqualType>::assert (AlmostEqualType res)
   {
+    OutputLock lock;
     int prec = std::cout.precision();
     std::cout.precision(_FLOAT_PRECISION);
 
@@ -488,53 +694,6 @@ namespace tester
     std::cout.precision(prec);
   }
 
-  // }}}
-  // ----------------------------------------
-  // TestMonitor definitions
-  // ----------------------------------------
-  // {{{
-
-  int TestMonitor::overally_failed = 0;
-  int TestMonitor::overally_run = 0;
-  std::vector<TestCase*> TestMonitor::test_cases;
-
-  void TestMonitor::register_test_case(TestCase *ptc)
-  {
-    test_cases.push_back(ptc);
-  }
-
-  void TestMonitor::run_rests()
-  {
-    if (test_cases.empty())
-    {
-      std::cerr << "No cases to run" << std::endl;
-      return;
-    }
-    for (auto tcIt = test_cases.begin(); tcIt != test_cases.end(); ++tcIt)
-    {
-      bool passed = (*tcIt)->run();
-      TestMonitor::test_case_result(passed);
-    }
-
-    std::cerr << std::string(std::max(_WIDTH, 0), '_') << std::endl;
-    std::ostringstream suff;
-    suff << "passed: "
-      << int(double(100*(overally_run - overally_failed))/overally_run)
-      << "% ( " << (overally_run - overally_failed) << " / " << overally_run << " )";
-    std::cerr << std::string(std::max(_WIDTH - signed(suff.str().length()), 0), ' ') << suff.str() << std::endl;
-  }
-
-  void TestMonitor::test_case_result(bool passed)
-  {
-    overally_failed += !passed;
-    ++overally_run;
-  }
-
-  bool TestMonitor::any_test_failed()
-  {
-    return overally_failed;
-  }
-
   // }}}
   // ----------------------------------------
   // Stream and cast operator existence checker
@@ -545,8 +704,10 @@ namespace tester
   {
     struct DummyType {};
 
-    template <typename T>
-      DummyType operator<< (std::ostream& out, const T& c);
+    // templated on the stream as well, so library overloads such as the one
+    // for std::basic_string are always more specialized than this fallback
+    template <typename C, typename Tr, typename T>
+      DummyType operator<< (std::basic_ostream<C, Tr>& out, const T& c);
 
     template <typename T>
       class CheckIf
@@ -610,43 +771,261 @@ namespace tester
       };
   }
 
+  // }}}
+  // ----------------------------------------
+  // TscClock class with definitions
+  // ----------------------------------------
+  // {{{
+
+  // Cycle counter backend for TimeTester. Calibrated lazily against
+  // CLOCK_MONOTONIC on first use; usable() is false when the TSC is missing
+  // or not invariant, in which case timers fall back to clock_gettime.
+  class TscClock
+  {
+  public:
+    static bool usable();
+    static uint64_t start_ticks();
+    static uint64_t stop_ticks();
+    static timespec ticks_to_timespec(uint64_t ticks);
+    static double ticks_per_ns() { calibrate(); return tpns; }
+    static uint64_t overhead() { calibrate(); return overhead_ticks; }
+
+    // set once a timer actually uses the TSC, so STOP_TIMER only reads it then
+    static std::atomic<bool> in_use;
+
+  private:
+    static void calibrate();
+    static void measure();
+    static bool invariant();
+    static bool rdtscp_supported();
+
+    static std::once_flag calibrated;
+    static bool available, has_rdtscp;
+    static double tpns;
+    static uint64_t overhead_ticks;
+  };
+
+  std::once_flag TscClock::calibrated;
+  std::atomic<bool> TscClock::in_use(false);
+  bool TscClock::available = false;
+  bool TscClock::has_rdtscp = false;
+  double TscClock::tpns = 0;
+  uint64_t TscClock::overhead_ticks = 0;
+
+  bool TscClock::usable()
+  {
+    calibrate();
+    return available;
+  }
+
+  uint64_t TscClock::start_ticks()
+  {
+#ifdef TESTER_X86
+    // keep earlier instructions from leaking into the measured region
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    return 0;
+#endif
+  }
+
+  uint64_t TscClock::stop_ticks()
+  {
+#ifdef TESTER_X86
+    // rdtscp waits for the measured code, lfence keeps later code out;
+    // without rdtscp (eg. hidden by a hypervisor) a leading lfence does both
+    uint64_t t;
+    if (has_rdtscp)
+    {
+      unsigned int aux;
+      t = __rdtscp(&aux);
+    }
+    else
+    {
+      _mm_lfence();
+      t = __rdtsc();
+    }
+    _mm_lfence();
+    return t;
+#else
+    return 0;
+#endif
+  }
+
+  bool TscClock::invariant()
+  {
+#ifdef TESTER_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+      return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return edx & (1 << 8);
+#else
+    return false;
+#endif
+  }
+
+  bool TscClock::rdtscp_supported()
+  {
+#ifdef TESTER_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000001)
+      return false;
+    __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    return edx & (1 << 27);
+#else
+    return false;
+#endif
+  }
+
+  void TscClock::calibrate()
+  {
+    // call_once publishes the measured values to every thread using the clock
+    std::call_once(calibrated, measure);
+  }
+
+  void TscClock::measure()
+  {
+    has_rdtscp = rdtscp_supported();
+    if (!invariant())
+      return;
+
+    // busy-wait ~20ms and compare elapsed ticks with elapsed nanoseconds
+    timespec ts_begin, ts_end;
+    clock_gettime(CLOCK_MONOTONIC, &ts_begin);
+    uint64_t t_begin = start_ticks();
+    long long ns;
+    do
+    {
+      clock_gettime(CLOCK_MONOTONIC, &ts_end);
+      ns = (ts_end.tv_sec - ts_begin.tv_sec) * 1000000000LL + ts_end.tv_nsec - ts_begin.tv_nsec;
+    }
+    while (ns < 20000000);
+    uint64_t t_end = stop_ticks();
+    tpns = double(t_end - t_begin) / ns;
+
+    // cost of an empty start/stop pair, subtracted from every measurement
+    overhead_ticks = UINT64_MAX;
+    for (int i = 0; i < 1000; ++i)
+    {
+      uint64_t st = start_ticks();
+      uint64_t nd = stop_ticks();
+      overhead_ticks = std::min(overhead_ticks, nd - st);
+    }
+
+    available = tpns > 0;
+  }
+
+  timespec TscClock::ticks_to_timespec(uint64_t ticks)
+  {
+    calibrate();
+    ticks = ticks > overhead_ticks ? ticks - overhead_ticks : 0;
+    long long ns = (long long)(ticks / tpns);
+    timespec res;
+    res.tv_sec = ns / 1000000000LL;
+    res.tv_nsec = ns % 1000000000LL;
+    return res;
+  }
+
   // }}}
   // ----------------------------------------
   // TimeTester class with definitions
   // ----------------------------------------
   // {{{
 
+  enum class ClockBackend { MONOTONIC_RAW, TSC };
+
+  // Both clocks read at one instant, so STOP_TIMER can take the time before
+  // looking its timer up; ticks are only read once a TSC timer exists (raw
+  // timers then also pay for that read, which is small next to clock_gettime)
+  struct ClockReading
+  {
+    uint64_t ticks;
+    timespec time;
+  };
+
+  ClockReading read_stop_clocks()
+  {
+    ClockReading res;
+    res.ticks = TscClock::in_use.load(std::memory_order_acquire) ? TscClock::stop_ticks() : 0;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &res.time);
+    return res;
+  }
+
   class TimeTester
   {
   public:
-    TimeTester() {}
-    TimeTester(std::string name);
+    TimeTester(): backend(ClockBackend::MONOTONIC_RAW) {}
+    TimeTester(std::string name, ClockBackend backend = ClockBackend::MONOTONIC_RAW);
 
     void start();
     void stop();
+    void stop_at(const ClockReading &now);
     timespec get_diff();
+    long long get_diff_ns() { return diff.tv_sec * 1000000000LL + diff.tv_nsec; }
     void pretty_report();
     void simple_report();
     static void simple_report_all_timers();
 
   private:
+    void diff_from_timespecs();
+
     timespec start_time, stop_time, diff;
+    uint64_t start_ticks;
+    double trace_begin;
     std::string name;
+    ClockBackend backend;
 
   };
 
   std::map<std::string, TimeTester> time_resters;
 
-  TimeTester::TimeTester(std::string name): name(name) { }
+  TimeTester::TimeTester(std::string name, ClockBackend backend): name(name), backend(backend)
+  {
+    if (backend == ClockBackend::TSC && !TscClock::usable())
+      this->backend = ClockBackend::MONOTONIC_RAW;
+    else if (backend == ClockBackend::TSC)
+      TscClock::in_use.store(true, std::memory_order_release);
+  }
 
   void TimeTester::start()
   {
-    clock_gettime(CLOCK_MONOTONIC_RAW, &start_time);
+    if (TraceRecorder::enabled() && !name.empty())
+      trace_begin = TraceRecorder::now_us();
+    if (backend == ClockBackend::TSC)
+      start_ticks = TscClock::start_ticks();
+    else
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start_time);
   }
 
   void TimeTester::stop()
   {
-    clock_gettime(CLOCK_MONOTONIC_RAW, &stop_time);
+    ClockReading now;
+    if (backend == ClockBackend::TSC)
+      now.ticks = TscClock::stop_ticks();
+    else
+      clock_gettime(CLOCK_MONOTONIC_RAW, &now.time);
+    stop_at(now);
+  }
+
+  void TimeTester::stop_at(const ClockReading &now)
+  {
+    if (backend == ClockBackend::TSC)
+      diff = TscClock::ticks_to_timespec(now.ticks - start_ticks);
+    else
+    {
+      stop_time = now.time;
+      diff_from_timespecs();
+    }
+
+    if (TraceRecorder::enabled() && !name.empty())
+      TraceRecorder::complete(name, "timer", trace_begin);
+  }
+
+  void TimeTester::diff_from_timespecs()
+  {
     if (stop_time.tv_nsec - start_time.tv_nsec < 0)
     {
       diff.tv_sec = stop_time.tv_sec - start_time.tv_sec - 1;
@@ -724,48 +1103,1331 @@ namespace tester
 
   // }}}
   // ----------------------------------------
-  // Utils
+  // TestMonitor definitions
   // ----------------------------------------
   // {{{
 
-  // TODO are float/double version needed?
-  // TODO implement better comparsion
-  AlmostEqualType almost_equal(float st, float nd, int max_ulps = TESTER_MAX_ULPS)
+  int TestMonitor::overally_failed = 0;
+  int TestMonitor::overally_run = 0;
+  bool TestMonitor::update_golden = false;
+  bool TestMonitor::failed_first = false;
+  bool TestMonitor::only_failed = false;
+  double TestMonitor::time_budget = -1;
+  std::string TestMonitor::state_path = ".tester_state";
+  std::map<std::string, TestMonitor::CaseState> TestMonitor::state;
+  std::map<const TestCase*, std::string> TestMonitor::state_ids;
+  std::vector<TestCase*> TestMonitor::test_cases;
+
+  void TestMonitor::register_test_case(TestCase *ptc)
   {
-    AlmostEqualType res;
-    res.st = st;
-    res.nd = nd;
-    res.max_ulps = max_ulps;
+    test_cases.push_back(ptc);
+  }
 
-    if ((st < 0) != (nd < 0))
+  // Forgets every registered case and releases the storage, for benchmarks
+  // that register cases they never run
+  void TestMonitor::clear_test_cases()
+  {
+    std::vector<TestCase*>().swap(test_cases);
+  }
+
+  bool TestMonitor::parse_args(int argc, char **argv)
+  {
+    for (int i = 1; i < argc; ++i)
     {
-      res.res = st == nd;
-      return res;
+      std::string arg = argv[i];
+      if (arg.compare(0, 8, "--trace=") == 0)
+        TraceRecorder::enable(arg.substr(8));
+      else if (arg == "--update-golden")
+        update_golden = true;
+      else if (arg == "--failed-first")
+        failed_first = true;
+      else if (arg == "--only-failed")
+        only_failed = true;
+      else if (arg.compare(0, 14, "--time-budget=") == 0)
+      {
+        const char *value = arg.c_str() + 14;
+        char *end;
+        time_budget = strtod(value, &end);
+        if (end == value || *end != '\0' || !std::isfinite(time_budget) || time_budget < 0)
+        {
+          std::cerr << "Invalid time budget \"" << value << "\"" << std::endl;
+          return false;
+        }
+      }
+      else if (arg.compare(0, 8, "--state=") == 0)
+        state_path = arg.substr(8);
+      else
+      {
+        std::cerr << "Invalid option \"" << arg << "\"" << std::endl;
+        return false;
+      }
     }
+    return true;
+  }
 
-    union float_i
+  // Keys cases by file and name, so editing code above a case keeps its
+  // history; repeated names in one file get " #2", " #3", ... in order
+  void TestMonitor::assign_state_ids()
+  {
+    std::map<std::string, int> seen;
+    state_ids.clear();
+    for (auto tc : test_cases)
     {
-      float f;
-      int32_t i;
-    };
+      std::string id = tc->get_id();
+      int n = ++seen[id];
+      state_ids[tc] = n == 1 ? id : id + " #" + std::to_string(n);
+    }
+  }
 
-    float_i st_f, nd_f;
-    st_f.f = st;
-    nd_f.f = nd;
+  // State file: one line per test case, "<passed> <duration_ns> <file> <name>";
+  // entries of cases that are no longer registered are dropped
+  void TestMonitor::load_state()
+  {
+    std::map<std::string, bool> registered;
+    for (auto &entry : state_ids)
+      registered[entry.second] = true;
 
-    res.res = std::abs(st_f.i - nd_f.i) <= max_ulps;
-    return res;
+    std::ifstream in(state_path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+      std::istringstream ss(line);
+      CaseState cs;
+      std::string id;
+      if (ss >> cs.passed >> cs.duration_ns && ss.get() == ' ' && std::getline(ss, id)
+          && registered.count(id))
+        state[id] = cs;
+    }
   }
 
-}
-
-  // }}}
-  // ----------------------------------------
-  // Macros
-  // ----------------------------------------
-  // {{{
+  void TestMonitor::save_state()
+  {
+    std::ofstream out(state_path);
+    if (!out)
+    {
+      std::cerr << "Cannot write state file \"" << state_path << "\"" << std::endl;
+      return;
+    }
+    for (auto &entry : state)
+      out << entry.second.passed << " " << entry.second.duration_ns << " " << entry.first << "\n";
+  }
 
-#define CHECK(expr) tester::Evaluer(#expr, __FILE__, __LINE__) << expr;
+  // Orders cases as recent failures, never run, then passed ones, and with a
+  // time budget greedily keeps the cheapest cases of each group that still
+  // fit; cases without a recorded duration are assumed to take the average
+  std::vector<TestCase*> TestMonitor::select_test_cases()
+  {
+    if (!failed_first && !only_failed && time_budget < 0)
+      return test_cases;
+
+    long long known_ns = 0, known = 0;
+    for (auto &entry : state)
+    {
+      known_ns += entry.second.duration_ns;
+      ++known;
+    }
+    long long estimate_ns = known ? known_ns / known : 0;
+
+    auto group = [](TestCase *tc) {
+      auto it = state.find(state_ids[tc]);
+      return it == state.end() ? 1 : it->second.passed ? 2 : 0;
+    };
+    auto duration = [&](TestCase *tc) {
+      auto it = state.find(state_ids[tc]);
+      return it == state.end() ? estimate_ns : it->second.duration_ns;
+    };
+
+    std::vector<TestCase*> res;
+    for (auto tc : test_cases)
+      if (!only_failed || group(tc) == 0)
+        res.push_back(tc);
+
+    if (time_budget < 0)
+    {
+      std::stable_sort(res.begin(), res.end(), [&](TestCase *st, TestCase *nd) {
+          return (group(st) == 0) > (group(nd) == 0);
+        });
+      return res;
+    }
+
+    std::stable_sort(res.begin(), res.end(), [&](TestCase *st, TestCase *nd) {
+        int gs = group(st), gn = group(nd);
+        return gs != gn ? gs < gn : duration(st) < duration(nd);
+      });
+
+    long long left_ns = (long long)(time_budget * 1e9);
+    std::vector<TestCase*> selected;
+    for (auto tc : res)
+    {
+      if (duration(tc) <= left_ns)
+      {
+        selected.push_back(tc);
+        left_ns -= duration(tc);
+      }
+    }
+    std::cerr << "Selected " << selected.size() << " of " << test_cases.size()
+      << " cases for a time budget of " << time_budget << "s" << std::endl;
+    return selected;
+  }
+
+  void TestMonitor::run_rests()
+  {
+    assign_state_ids();
+    load_state();
+    std::vector<TestCase*> selected = select_test_cases();
+    if (selected.empty())
+    {
+      std::cerr << "No cases to run" << std::endl;
+      return;
+    }
+    for (auto tcIt = selected.begin(); tcIt != selected.end(); ++tcIt)
+    {
+      // unnamed, so the case does not also show up as a timer in the trace
+      TimeTester timer;
+      timer.start();
+      bool passed = (*tcIt)->run();
+      timer.stop();
+      TestMonitor::test_case_result(passed);
+
+      CaseState &cs = state[state_ids[*tcIt]];
+      cs.passed = passed;
+      cs.duration_ns = timer.get_diff_ns();
+    }
+    save_state();
+
+    std::cerr << std::string(std::max(_WIDTH, 0), '_') << std::endl;
+    std::ostringstream suff;
+    suff << "passed: "
+      << int(double(100*(overally_run - overally_failed))/overally_run)
+      << "% ( " << (overally_run - overally_failed) << " / " << overally_run << " )";
+    std::cerr << std::string(std::max(_WIDTH - signed(suff.str().length()), 0), ' ') << suff.str() << std::endl;
+
+    TraceRecorder::write();
+  }
+
+  void TestMonitor::test_case_result(bool passed)
+  {
+    overally_failed += !passed;
+    ++overally_run;
+  }
+
+  bool TestMonitor::any_test_failed()
+  {
+    return overally_failed;
+  }
+
+  // }}}
+  // ----------------------------------------
+  // ScopedTimer class with definitions
+  // ----------------------------------------
+  // {{{
+
+  struct ScopeNode
+  {
+    ScopeNode(std::string name, ScopeNode *parent): name(name), inclusive_ns(0), calls(0), parent(parent) { }
+
+    ScopeNode *child(const std::string &child_name);
+    long long exclusive_ns() const;
+
+    std::string name;
+    long long inclusive_ns;
+    long calls;
+    ScopeNode *parent;
+    std::list<ScopeNode> children;
+  };
+
+  ScopeNode *ScopeNode::child(const std::string &child_name)
+  {
+    for (auto &c : children)
+      if (c.name == child_name)
+        return &c;
+    children.emplace_back(child_name, this);
+    return &children.back();
+  }
+
+  long long ScopeNode::exclusive_ns() const
+  {
+    long long res = inclusive_ns;
+    for (auto &c : children)
+      res -= c.inclusive_ns;
+    return res;
+  }
+
+  // RAII timer building a per-thread call tree of nested scopes
+  class ScopedTimer
+  {
+  public:
+    ScopedTimer(std::string name);
+    ~ScopedTimer();
+
+    static void pretty_report();
+    static void collapsed_report(std::ostream &out);
+    static void reset();
+
+  private:
+    static void pretty_report(const ScopeNode &node, const std::string &indent);
+    static void collapsed_report(std::ostream &out, const ScopeNode &node, const std::string &stack);
+
+    static thread_local ScopeNode root;
+    static thread_local ScopeNode *current;
+
+    ScopeNode *node;
+    TimeTester timer;
+  };
+
+  thread_local ScopeNode ScopedTimer::root("", nullptr);
+  thread_local ScopeNode *ScopedTimer::current = &ScopedTimer::root;
+
+  std::string seconds_repr(long long ns)
+  {
+    std::ostringstream ss;
+    ss << ns / 1000000000LL << "." << std::setw(9) << std::setfill('0') << ns % 1000000000LL << "s";
+    return ss.str();
+  }
+
+  ScopedTimer::ScopedTimer(std::string name): node(current->child(name)), timer(name)
+  {
+    current = node;
+    timer.start();
+  }
+
+  ScopedTimer::~ScopedTimer()
+  {
+    timer.stop();
+    node->inclusive_ns += timer.get_diff_ns();
+    node->calls += 1;
+    current = node->parent;
+  }
+
+  // Drops the calling thread's tree; open scopes point into it, so it is
+  // only cleared outside of any SCOPED_TIMER
+  void ScopedTimer::reset()
+  {
+    if (current != &root)
+    {
+      std::cerr << prefix << "Cannot reset scopes inside a SCOPED_TIMER" << std::endl;
+      return;
+    }
+    root.children.clear();
+  }
+
+  void ScopedTimer::pretty_report()
+  {
+    for (auto &c : root.children)
+      pretty_report(c, prefix);
+  }
+
+  void ScopedTimer::pretty_report(const ScopeNode &node, const std::string &indent)
+  {
+    std::ostringstream pref, suff;
+    pref << indent << "Scope \"" << node.name << "\"  ";
+    suff << "  " << seconds_repr(node.inclusive_ns) << " incl / "
+      << seconds_repr(node.exclusive_ns()) << " excl / "
+      << node.calls << " calls";
+
+    int fillLen = std::max(_WIDTH - signed(pref.str().length()) - signed(suff.str().length()), 3);
+    std::cerr << pref.str() << std::string(fillLen, '.') << suff.str() << std::endl;
+
+    for (auto &c : node.children)
+      pretty_report(c, indent + "    ");
+  }
+
+  void ScopedTimer::collapsed_report(std::ostream &out)
+  {
+    for (auto &c : root.children)
+      collapsed_report(out, c, "");
+  }
+
+  void ScopedTimer::collapsed_report(std::ostream &out, const ScopeNode &node, const std::string &stack)
+  {
+    // ';' separates frames in the collapsed-stack format
+    std::string frame = node.name;
+    std::replace(frame.begin(), frame.end(), ';', ':');
+    std::string path = stack.empty() ? frame : stack + ";" + frame;
+
+    out << path << " " << node.exclusive_ns() << std::endl;
+    for (auto &c : node.children)
+      collapsed_report(out, c, path);
+  }
+
+  // }}}
+  // ----------------------------------------
+  // Performance checks
+  // ----------------------------------------
+  // {{{
+
+  long long median_ns(std::vector<long long> samples)
+  {
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+  }
+
+  // Drives the body of CHECK_TIME_BELOW: next() times the previous run and
+  // returns false after the last one, checking the median against the budget
+  class TimeBudget
+  {
+  public:
+    TimeBudget(double budget_s, std::string expr, std::string file, int line):
+      budget_ns((long long)(budget_s * 1e9)), evaluer(expr, file, line), timer(expr), running(false) { }
+
+    bool next();
+
+  private:
+    void check();
+
+    long long budget_ns;
+    Evaluer evaluer;
+    TimeTester timer;
+    std::vector<long long> samples;
+    bool running;
+  };
+
+  bool TimeBudget::next()
+  {
+    if (running)
+    {
+      timer.stop();
+      samples.push_back(timer.get_diff_ns());
+    }
+    running = signed(samples.size()) < _TIME_REPEATS;
+    if (running)
+      timer.start();
+    else
+      check();
+    return running;
+  }
+
+  void TimeBudget::check()
+  {
+    long long median = median_ns(samples);
+    bool val = median < budget_ns;
+    OutputLock lock;
+    std::ostream& out = val ? std::cout : std::cerr;
+    assert_common_part(out, val, evaluer);
+    out << seconds_repr(median) << " < " << seconds_repr(budget_ns)
+      << " / ( median of " << samples.size() << " runs ) -> " << std::boolalpha << val << std::endl;
+  }
+
+  enum Complexity { O_1, O_LOG_N, O_N, O_N_LOG_N, O_N2, O_N3 };
+
+  const char *complexity_repr(Complexity c)
+  {
+    static const char *names[] = { "O(1)", "O(log N)", "O(N)", "O(N log N)", "O(N^2)", "O(N^3)" };
+    return names[c];
+  }
+
+  double complexity_curve(Complexity c, double n)
+  {
+    switch (c)
+    {
+      case O_1: return 1;
+      case O_LOG_N: return std::log2(n);
+      case O_N: return n;
+      case O_N_LOG_N: return n * std::log2(n);
+      case O_N2: return n * n;
+      case O_N3: return n * n * n;
+    }
+    return 0;
+  }
+
+  // Fits t = a + c * f(n) with a, c >= 0, weighting every point by 1 / t^2 so
+  // that each size counts by its relative error rather than the largest size
+  // deciding alone; the constant absorbs timer and call overhead. Returns
+  // the root mean square of the relative residuals.
+  double complexity_fit(Complexity c, const std::vector<double> &ns, const std::vector<double> &ts)
+  {
+    double sw = 0, sf = 0, sff = 0, st = 0, sft = 0;
+    for (size_t i = 0; i < ns.size(); ++i)
+    {
+      double w = 1 / (ts[i] * ts[i]);
+      double f = complexity_curve(c, ns[i]);
+      sw += w;
+      sf += w * f;
+      sff += w * f * f;
+      st += w * ts[i];
+      sft += w * f * ts[i];
+    }
+
+    double a = 0, coef = 0;
+    double det = sw * sff - sf * sf;
+    if (c != O_1 && det > 0)
+    {
+      a = (st * sff - sf * sft) / det;
+      coef = (sw * sft - sf * st) / det;
+    }
+    if (c == O_1 || det <= 0 || coef < 0)
+    {
+      a = st / sw;
+      coef = 0;
+    }
+    else if (a < 0)
+    {
+      a = 0;
+      coef = sft / sff;
+    }
+
+    double err = 0;
+    for (size_t i = 0; i < ns.size(); ++i)
+    {
+      double d = (ts[i] - a - coef * complexity_curve(c, ns[i])) / ts[i];
+      err += d * d;
+    }
+    return std::sqrt(err / ns.size());
+  }
+
+  // Times fn(n) for every n in sizes and takes the candidate curve with the
+  // smallest relative error as the best fit. A best fit still off by more
+  // than _COMPLEXITY_MAX_RMS, or fewer than three sizes, is inconclusive and
+  // fails the check.
+  template <typename Sizes, typename Fn>
+    void check_complexity(const Sizes &sizes, Fn fn, Complexity declared, std::string expr, std::string file, int line)
+    {
+      std::vector<double> ns, ts;
+      TimeTester timer(expr);
+      for (auto n : sizes)
+      {
+        std::vector<long long> samples;
+        for (int i = 0; i < _TIME_REPEATS; ++i)
+        {
+          timer.start();
+          fn(n);
+          timer.stop();
+          samples.push_back(timer.get_diff_ns());
+        }
+        ns.push_back(double(n));
+        ts.push_back(double(std::max(median_ns(samples), 1LL)));
+      }
+
+      Complexity best = O_1;
+      double best_rms = DBL_MAX;
+      for (int c = O_1; c <= O_N3 && ns.size() >= 3; ++c)
+      {
+        double rms = complexity_fit(Complexity(c), ns, ts);
+        if (rms < best_rms)
+        {
+          best = Complexity(c);
+          best_rms = rms;
+        }
+      }
+
+      bool conclusive = best_rms <= _COMPLEXITY_MAX_RMS;
+      bool val = conclusive && best <= declared;
+      Evaluer evaluer(expr, file, line);
+      OutputLock lock;
+      std::ostream& out = val ? std::cout : std::cerr;
+      assert_common_part(out, val, evaluer);
+      if (ns.size() < 3)
+        out << "inconclusive, at least 3 sizes needed /" << std::endl;
+      else
+      {
+        out << complexity_repr(best) << " <= " << complexity_repr(declared)
+          << " / ( best fit of " << ns.size() << " sizes, rms " << int(100 * best_rms) << "%"
+          << (conclusive ? "" : ", inconclusive") << " ) -> " << std::boolalpha << val << std::endl;
+      }
+    }
+
+  // }}}
+  // ----------------------------------------
+  // Cache eviction and warm/cold benchmarks
+  // ----------------------------------------
+  // {{{
+
+  // How to cool caches before a cold iteration: sweep a buffer larger than
+  // the last level cache, or clflush only the given region, and optionally
+  // touch one byte per page of a large buffer to evict TLB entries
+  struct EvictOptions
+  {
+    EvictOptions(const void *region = nullptr, size_t region_size = 0, bool tlb = false):
+      region(region), region_size(region_size), tlb(tlb) { }
+
+    const void *region;
+    size_t region_size;
+    bool tlb;
+  };
+
+  class CacheEvictor
+  {
+  public:
+    static size_t llc_size();
+    static void sweep();
+    static void flush(const void *region, size_t size);
+    static void tlb_sweep();
+    static void evict(const EvictOptions &opts);
+
+  private:
+    static const size_t line_size = 64;
+    static const size_t page_size = 4096;
+    static const size_t tlb_buffer_size = 64 << 20;
+
+    static volatile char sink;
+  };
+
+  const size_t CacheEvictor::line_size;
+  const size_t CacheEvictor::page_size;
+  const size_t CacheEvictor::tlb_buffer_size;
+  volatile char CacheEvictor::sink;
+
+  size_t CacheEvictor::llc_size()
+  {
+    static size_t size = 0;
+    if (size)
+      return size;
+
+    int best_level = 0;
+    for (int i = 0; ; ++i)
+    {
+      std::ostringstream dir;
+      dir << "/sys/devices/system/cpu/cpu0/cache/index" << i << "/";
+      std::ifstream level_file(dir.str() + "level"), size_file(dir.str() + "size");
+      int level;
+      size_t value;
+      char unit = 0;
+      if (!(level_file >> level) || !(size_file >> value))
+        break;
+      size_file >> unit;
+      if (unit == 'K')
+        value <<= 10;
+      else if (unit == 'M')
+        value <<= 20;
+      if (level >= best_level)
+      {
+        best_level = level;
+        size = value;
+      }
+    }
+    if (!size)
+      size = 32 << 20;
+    return size;
+  }
+
+  // Reads only, so the caches are left holding clean lines and the timed
+  // run does not pay for writing the sweep buffer back to memory
+  void CacheEvictor::sweep()
+  {
+    static std::vector<char> buffer(2 * llc_size());
+    const volatile char *p = buffer.data();
+    char acc = 0;
+    for (size_t i = 0; i < buffer.size(); i += line_size)
+      acc ^= p[i];
+    sink = acc;
+  }
+
+  void CacheEvictor::flush(const void *region, size_t size)
+  {
+#ifdef TESTER_X86
+    const char *p = static_cast<const char*>(region);
+    for (size_t i = 0; i < size; i += line_size)
+      _mm_clflush(p + i);
+    if (size)
+      _mm_clflush(p + size - 1);
+    _mm_mfence();
+#else
+    sweep();
+#endif
+  }
+
+  void CacheEvictor::tlb_sweep()
+  {
+    static std::vector<char> buffer(tlb_buffer_size);
+    const volatile char *p = buffer.data();
+    char acc = 0;
+    // offset each access by a line so the pages do not all map to one cache set
+    for (size_t i = 0, off = 0; i < buffer.size(); i += page_size, off = (off + line_size) % page_size)
+      acc ^= p[i + off];
+    sink = acc;
+  }
+
+  void CacheEvictor::evict(const EvictOptions &opts)
+  {
+    if (opts.region)
+      flush(opts.region, opts.region_size);
+    else
+      sweep();
+    if (opts.tlb)
+      tlb_sweep();
+  }
+
+  // Drives the body of BENCH_WARM_COLD: one discarded warm-up run, then
+  // repeats warm runs, then repeats runs each preceded by cache eviction
+  class WarmColdBench
+  {
+  public:
+    WarmColdBench(std::string name, int repeats, EvictOptions opts = EvictOptions()):
+      name(name), repeats(repeats), iteration(0), opts(opts), timer(name) { }
+
+    bool next();
+    void pretty_report();
+
+  private:
+    std::string name;
+    int repeats, iteration;
+    EvictOptions opts;
+    TimeTester timer;
+    std::vector<long long> warm, cold;
+  };
+
+  bool WarmColdBench::next()
+  {
+    if (iteration > 0)
+    {
+      timer.stop();
+      if (iteration > repeats + 1)
+        cold.push_back(timer.get_diff_ns());
+      else if (iteration > 1)
+        warm.push_back(timer.get_diff_ns());
+    }
+    if (iteration == 2 * repeats + 1)
+    {
+      pretty_report();
+      return false;
+    }
+
+    ++iteration;
+    if (iteration > repeats + 1)
+      CacheEvictor::evict(opts);
+    timer.start();
+    return true;
+  }
+
+  void WarmColdBench::pretty_report()
+  {
+    if (warm.empty())
+      return;
+    long long warm_ns = median_ns(warm), cold_ns = median_ns(cold);
+
+    std::ostringstream pref, suff;
+    pref << prefix << "Timer \"" << name << "\" warm/cold  ";
+    suff << "  warm " << seconds_repr(warm_ns) << " / cold " << seconds_repr(cold_ns)
+      << " / x" << std::fixed << std::setprecision(2) << (warm_ns ? double(cold_ns) / warm_ns : 0.0)
+      << " ( median of " << repeats << " runs )";
+
+    int fillLen = std::max(_WIDTH - signed(pref.str().length()) - signed(suff.str().length()), 3);
+    std::cerr << pref.str() << std::string(fillLen, '.') << suff.str() << std::endl;
+  }
+
+  // }}}
+  // ----------------------------------------
+  // Golden file comparison
+  // ----------------------------------------
+  // {{{
+
+  // Read-only mapping of a whole file, empty files map to a null data()
+  class MappedFile
+  {
+  public:
+    MappedFile(const std::string &path);
+    ~MappedFile();
+
+    bool is_open() const { return opened; }
+    const char *data() const { return ptr; }
+    size_t size() const { return length; }
+
+  private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator= (const MappedFile&);
+
+    const char *ptr;
+    size_t length;
+    bool opened;
+  };
+
+  MappedFile::MappedFile(const std::string &path): ptr(nullptr), length(0), opened(false)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+      length = st.st_size;
+      opened = true;
+      if (length > 0)
+      {
+        void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+          length = 0;
+          opened = false;
+        }
+        else
+        {
+          madvise(p, length, MADV_SEQUENTIAL);
+          ptr = static_cast<const char*>(p);
+        }
+      }
+    }
+    close(fd);
+  }
+
+  MappedFile::~MappedFile()
+  {
+    if (ptr)
+      munmap(const_cast<char*>(ptr), length);
+  }
+
+  struct BufferView
+  {
+    const char *data;
+    size_t size;
+  };
+
+  BufferView as_buffer(const void *data, size_t size)
+  {
+    return BufferView{static_cast<const char*>(data), size};
+  }
+
+  BufferView as_buffer(const std::string &str)
+  {
+    return as_buffer(str.data(), str.size());
+  }
+
+  // Marks the actual side of CHECK_FILE_EQ as a file to map; strings and
+  // char pointers are always compared as contents
+  struct FilePath
+  {
+    std::string path;
+  };
+
+  FilePath path(const std::string &path)
+  {
+    return FilePath{path};
+  }
+
+  // paths are printed back in messages, keep them to a sane length
+  std::string path_repr(const std::string &path)
+  {
+    return path.length() <= 128 ? path : path.substr(0, 125) + "...";
+  }
+
+  class GoldenFile
+  {
+  public:
+    static void check(BufferView actual, const std::string &golden_path, std::string expr, std::string file, int line);
+    static void check(const std::string &actual, const std::string &golden_path, std::string expr, std::string file, int line);
+    static void check(const char *actual, const std::string &golden_path, std::string expr, std::string file, int line);
+    static void check(const FilePath &actual, const std::string &golden_path, std::string expr, std::string file, int line);
+
+  private:
+    static size_t first_difference(BufferView st, BufferView nd);
+    static void print_context(std::ostream &out, const char *label, BufferView buf, size_t offset);
+    static bool write_atomically(BufferView contents, const std::string &path);
+
+    static const size_t chunk_size = 1 << 20;
+    static const size_t context = 16;
+  };
+
+  const size_t GoldenFile::chunk_size;
+  const size_t GoldenFile::context;
+
+  size_t GoldenFile::first_difference(BufferView st, BufferView nd)
+  {
+    size_t common = std::min(st.size, nd.size);
+    size_t pos = 0;
+    // memcmp is vectorized by the C library, narrow down byte by byte only
+    // inside the first chunk that differs
+    while (pos < common)
+    {
+      size_t len = std::min(chunk_size, common - pos);
+      if (memcmp(st.data + pos, nd.data + pos, len) != 0)
+      {
+        while (st.data[pos] == nd.data[pos])
+          ++pos;
+        return pos;
+      }
+      pos += len;
+    }
+    return common;
+  }
+
+  void GoldenFile::print_context(std::ostream &out, const char *label, BufferView buf, size_t offset)
+  {
+    size_t begin = offset > context ? offset - context : 0;
+    size_t end = std::min(buf.size, offset + context);
+
+    std::ostringstream hex, text;
+    hex << std::hex << std::setfill('0');
+    for (size_t i = begin; i < end; ++i)
+    {
+      unsigned char c = buf.data[i];
+      hex << (i == offset ? "[" : i == begin ? "" : " ") << std::setw(2) << int(c) << (i == offset ? "]" : "");
+      text << (i == offset ? "[" : "") << (c >= 0x20 && c < 0x7f ? char(c) : '.') << (i == offset ? "]" : "");
+    }
+    if (offset >= buf.size)
+      hex << (begin == end ? "" : " ") << "[EOF]";
+
+    out << prefix << "    / " << label << " @" << begin << ": " << hex.str() << std::endl;
+    out << prefix << "    / " << std::string(strlen(label), ' ') << "  " << std::string(std::to_string(begin).length(), ' ')
+      << "  " << text.str() << std::endl;
+  }
+
+  bool GoldenFile::write_atomically(BufferView contents, const std::string &path)
+  {
+    std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+
+    size_t written = 0;
+    while (written < contents.size)
+    {
+      ssize_t res = write(fd, contents.data + written, contents.size - written);
+      if (res < 0)
+        break;
+      written += res;
+    }
+    bool ok = written == contents.size && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp_path.c_str(), path.c_str()) == 0;
+    if (!ok)
+      unlink(tmp_path.c_str());
+    return ok;
+  }
+
+  void GoldenFile::check(BufferView actual, const std::string &golden_path, std::string expr, std::string file, int line)
+  {
+    Evaluer evaluer(expr, file, line);
+    MappedFile golden(golden_path);
+    BufferView expected = as_buffer(golden.data(), golden.size());
+
+    size_t diff = golden.is_open() ? first_difference(actual, expected) : 0;
+    bool equal = golden.is_open() && diff == actual.size && diff == expected.size;
+
+    OutputLock lock;
+    if (!equal && TestMonitor::update_golden_files())
+    {
+      bool val = write_atomically(actual, golden_path);
+      std::ostream& out = val ? std::cout : std::cerr;
+      assert_common_part(out, val, evaluer);
+      out << (val ? "updated " : "cannot update ") << path_repr(golden_path) << " ( " << actual.size << " bytes ) /" << std::endl;
+      return;
+    }
+
+    std::ostream& out = equal ? std::cout : std::cerr;
+    assert_common_part(out, equal, evaluer);
+    if (!golden.is_open())
+      out << "cannot read " << path_repr(golden_path) << " /" << std::endl;
+    else if (equal)
+      out << path_repr(golden_path) << " ( " << expected.size << " bytes ) /" << std::endl;
+    else
+    {
+      out << "first difference at offset " << diff << " ( actual " << actual.size
+        << " bytes, golden " << expected.size << " bytes ) /" << std::endl;
+      print_context(out, "actual", actual, diff);
+      print_context(out, "golden", expected, diff);
+    }
+  }
+
+  void GoldenFile::check(const std::string &actual, const std::string &golden_path, std::string expr, std::string file, int line)
+  {
+    check(as_buffer(actual), golden_path, expr, file, line);
+  }
+
+  void GoldenFile::check(const char *actual, const std::string &golden_path, std::string expr, std::string file, int line)
+  {
+    check(as_buffer(actual, strlen(actual)), golden_path, expr, file, line);
+  }
+
+  void GoldenFile::check(const FilePath &actual_path, const std::string &golden_path, std::string expr, std::string file, int line)
+  {
+    MappedFile actual(actual_path.path);
+    if (!actual.is_open())
+    {
+      Evaluer evaluer(expr, file, line);
+      OutputLock lock;
+      assert_common_part(std::cerr, false, evaluer);
+      std::cerr << "cannot read " << path_repr(actual_path.path) << " /" << std::endl;
+      return;
+    }
+    check(as_buffer(actual.data(), actual.size()), golden_path, expr, file, line);
+  }
+
+  // }}}
+  // ----------------------------------------
+  // Data-driven test cases
+  // ----------------------------------------
+  // {{{
+
+  // Zero-copy view of one field inside a mapped data file
+  struct FieldView
+  {
+    const char *data;
+    size_t size;
+
+    std::string str() const { return std::string(data, size); }
+
+    // parses the field as text, eg. a CSV number; leniently, "12abc" is 12
+    // and a field that is not a number at all is T()
+    template <typename T>
+      T value() const
+      {
+        T res = T();
+        parse(res, kind<T>());
+        return res;
+      }
+
+    // like value(), but only succeeds if the whole field is a number that
+    // fits in T; res is left untouched otherwise
+    template <typename T>
+      bool parse(T &res) const
+      {
+        T tmp = T();
+        if (!parse(tmp, kind<T>()))
+          return false;
+        res = tmp;
+        return true;
+      }
+
+    // reinterprets the field bytes, eg. a binary integer
+    template <typename T>
+      T raw() const
+      {
+        T res = T();
+        memcpy(&res, data, std::min(sizeof(T), size));
+        return res;
+      }
+
+  private:
+    // numbers are parsed from a NUL-terminated stack copy, the view itself
+    // may end at the end of the mapping
+    static const size_t number_size = 64;
+
+    bool copy_number(char *buf) const
+    {
+      if (size >= number_size)
+        return false;
+      memcpy(buf, data, size);
+      buf[size] = '\0';
+      return true;
+    }
+
+    template <typename T>
+      using kind = std::integral_constant<int,
+            std::is_floating_point<T>::value ? 2 : std::is_integral<T>::value ? 1 : 0>;
+
+    // each sets res as leniently as value() needs and returns whether the
+    // whole field was consumed without overflow
+    template <typename T>
+      bool parse(T &res, std::integral_constant<int, 1>) const
+      {
+        char buf[number_size];
+        if (!copy_number(buf))
+          return parse(res, std::integral_constant<int, 0>());
+        char *end;
+        errno = 0;
+        bool fits;
+        if (std::is_signed<T>::value)
+        {
+          long long v = strtoll(buf, &end, 10);
+          fits = v >= (long long)std::numeric_limits<T>::min() && v <= (long long)std::numeric_limits<T>::max();
+          res = T(v);
+        }
+        else
+        {
+          unsigned long long v = strtoull(buf, &end, 10);
+          fits = !memchr(buf, '-', size) && v <= (unsigned long long)std::numeric_limits<T>::max();
+          res = T(v);
+        }
+        return end != buf && *end == '\0' && errno != ERANGE && fits;
+      }
+
+    template <typename T>
+      bool parse(T &res, std::integral_constant<int, 2>) const
+      {
+        char buf[number_size];
+        if (!copy_number(buf))
+          return parse(res, std::integral_constant<int, 0>());
+        char *end;
+        errno = 0;
+        res = T(strtod(buf, &end));
+        return end != buf && *end == '\0' && errno != ERANGE;
+      }
+
+    template <typename T>
+      bool parse(T &res, std::integral_constant<int, 0>) const
+      {
+        std::istringstream ss(str());
+        return ss >> res && (ss >> std::ws).eof();
+      }
+  };
+
+  bool operator== (const FieldView &st, const FieldView &nd)
+  {
+    return st.size == nd.size && memcmp(st.data, nd.data, st.size) == 0;
+  }
+
+  bool operator!= (const FieldView &st, const FieldView &nd)
+  {
+    return !(st == nd);
+  }
+
+  std::ostream& operator<< (std::ostream &out, const FieldView &field)
+  {
+    return out.write(field.data, field.size);
+  }
+
+  struct Record
+  {
+    size_t index;
+    std::vector<FieldView> fields;
+
+    size_t size() const { return fields.size(); }
+    // fields past the end are empty, so a short CSV line reads as blanks
+    FieldView operator[] (size_t i) const { return i < fields.size() ? fields[i] : FieldView{"", 0}; }
+  };
+
+  // Reads records from a range of a mapped file. Files ending in ".csv" are
+  // lines of comma-separated fields (no quoting, empty lines skipped); any
+  // other file is binary: per record a uint32 field count, then per field a
+  // uint32 length followed by that many bytes, all little-endian.
+  class RecordReader
+  {
+  public:
+    enum Format { BINARY, CSV };
+
+    RecordReader(const char *data, size_t size, Format format, size_t first_index = 0):
+      data(data), size(size), pos(0), index(first_index), format(format), error(false) { }
+
+    static Format format_for(const std::string &path);
+
+    bool next(Record &record);
+    bool failed() const { return error; }
+    size_t next_index() const { return index; }
+    std::vector<RecordReader> split(size_t chunks) const;
+
+  private:
+    bool next_binary(Record &record);
+    bool next_csv(Record &record);
+    bool read_u32(uint32_t &value);
+
+    const char *data;
+    size_t size, pos, index;
+    Format format;
+    bool error;
+  };
+
+  RecordReader::Format RecordReader::format_for(const std::string &path)
+  {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0 ? CSV : BINARY;
+  }
+
+  bool RecordReader::next(Record &record)
+  {
+    record.fields.clear();
+    record.index = index;
+    bool res = format == CSV ? next_csv(record) : next_binary(record);
+    if (res)
+      ++index;
+    return res;
+  }
+
+  bool RecordReader::read_u32(uint32_t &value)
+  {
+    if (size - pos < 4)
+      return false;
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data + pos);
+    value = p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+    pos += 4;
+    return true;
+  }
+
+  bool RecordReader::next_binary(Record &record)
+  {
+    if (pos == size || error)
+      return false;
+
+    uint32_t count, length;
+    error = !read_u32(count);
+    for (uint32_t i = 0; i < count && !error; ++i)
+    {
+      error = !read_u32(length) || size - pos < length;
+      if (!error)
+      {
+        record.fields.push_back(FieldView{data + pos, length});
+        pos += length;
+      }
+    }
+    return !error;
+  }
+
+  bool RecordReader::next_csv(Record &record)
+  {
+    const char *end = data + size;
+    const char *line = data + pos;
+    const char *eol;
+    // skip empty lines
+    while (line < end && (*line == '\n' || *line == '\r'))
+      ++line;
+    if (line == end)
+    {
+      pos = size;
+      return false;
+    }
+
+    eol = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (!eol)
+      eol = end;
+    pos = eol - data + (eol < end);
+    if (eol > line && eol[-1] == '\r')
+      --eol;
+
+    while (true)
+    {
+      const char *comma = static_cast<const char*>(memchr(line, ',', eol - line));
+      const char *field_end = comma ? comma : eol;
+      record.fields.push_back(FieldView{line, size_t(field_end - line)});
+      if (!comma)
+        break;
+      line = comma + 1;
+    }
+    return true;
+  }
+
+  std::vector<RecordReader> RecordReader::split(size_t chunks) const
+  {
+    std::vector<RecordReader> res;
+    RecordReader walker(*this);
+    Record scratch;
+    size_t start = pos, start_index = index;
+
+    for (size_t k = 1; k < chunks; ++k)
+    {
+      size_t target = pos + (size - pos) * k / chunks;
+      while (walker.pos < target && walker.next(scratch))
+        ;
+      if (walker.error || walker.pos == start)
+        continue;
+      res.push_back(RecordReader(data + start, walker.pos - start, format, start_index));
+      start = walker.pos;
+      start_index = walker.index;
+    }
+    res.push_back(RecordReader(data + start, size - start, format, start_index));
+    return res;
+  }
+
+  // TestCase whose body runs once per record of a data file, optionally with
+  // the records split into chunks checked on separate threads. Only CHECKs
+  // are serialized between chunks; TEST_SUBCASE and START_TIMER share global
+  // state and do not belong in a record body (a subcase would also rerun the
+  // whole file once per record)
+  class DataTestCase : public TestCase
+  {
+  protected:
+    DataTestCase(std::string name, std::string file, int line, std::string data_path, size_t chunks = 1):
+      TestCase(name, file, line), data_path(data_path), chunks(chunks) { }
+
+  private:
+    void _run();
+    void run_chunk(RecordReader reader);
+    void fail(const std::string &expr, const std::string &what);
+
+    virtual void _run_record(const Record &record) = 0;
+
+    std::string data_path;
+    size_t chunks;
+  };
+
+  void DataTestCase::fail(const std::string &expr, const std::string &what)
+  {
+    Evaluer evaluer(expr, get_file(), get_line());
+    OutputLock lock;
+    assert_common_part(std::cerr, false, evaluer);
+    std::cerr << what << " /" << std::endl;
+  }
+
+  void DataTestCase::run_chunk(RecordReader reader)
+  {
+    Record record;
+    while (reader.next(record))
+    {
+      current_record = record.index;
+      _run_record(record);
+    }
+    current_record = -1;
+
+    if (reader.failed())
+    {
+      std::ostringstream what;
+      what << "malformed record " << reader.next_index() << " in " << data_path;
+      fail("valid records", what.str());
+    }
+  }
+
+  void DataTestCase::_run()
+  {
+    MappedFile mapped(data_path);
+    if (!mapped.is_open())
+    {
+      fail("readable " + data_path, "cannot read " + data_path);
+      return;
+    }
+
+    RecordReader reader(mapped.data(), mapped.size(), RecordReader::format_for(data_path));
+    std::vector<RecordReader> parts = reader.split(std::max<size_t>(chunks, 1));
+    if (parts.size() == 1)
+    {
+      run_chunk(parts[0]);
+      return;
+    }
+
+    parallel_output = true;
+    std::vector<std::thread> threads;
+    for (auto &part : parts)
+      threads.push_back(std::thread(&DataTestCase::run_chunk, this, part));
+    for (auto &t : threads)
+      t.join();
+    parallel_output = false;
+  }
+
+  // }}}
+  // ----------------------------------------
+  // Utils
+  // ----------------------------------------
+  // {{{
+
+  // TODO are float/double version needed?
+  // TODO implement better comparsion
+  AlmostEqualType almost_equal(float st, float nd, int max_ulps = TESTER_MAX_ULPS)
+  {
+    AlmostEqualType res;
+    res.st = st;
+    res.nd = nd;
+    res.max_ulps = max_ulps;
+
+    if ((st < 0) != (nd < 0))
+    {
+      res.res = st == nd;
+      return res;
+    }
+
+    union float_i
+    {
+      float f;
+      int32_t i;
+    };
+
+    float_i st_f, nd_f;
+    st_f.f = st;
+    nd_f.f = nd;
+
+    res.res = std::abs(st_f.i - nd_f.i) <= max_ulps;
+    return res;
+  }
+
+}
+
+  // }}}
+  // ----------------------------------------
+  // Macros
+  // ----------------------------------------
+  // {{{
+
+#define CHECK(expr) tester::Evaluer(#expr, __FILE__, __LINE__) << expr;
+
+#define CHECK_TIME_BELOW(budget) for (tester::TimeBudget CONCAT(__time_budget_, __LINE__)(budget, "time < " #budget "s", __FILE__, __LINE__); CONCAT(__time_budget_, __LINE__).next(); )
+
+#define CHECK_COMPLEXITY(sizes, fn, complexity) tester::check_complexity(sizes, fn, tester::complexity, "complexity of " #fn " <= " #complexity, __FILE__, __LINE__);
+
+#define CHECK_FILE_EQ(actual, golden_path) tester::GoldenFile::check(actual, golden_path, "file " #actual " == " #golden_path, __FILE__, __LINE__);
 
 #define CONCAT_(x, y) x##y
 #define CONCAT(x, y) CONCAT_(x, y)
@@ -785,6 +2447,20 @@ CONCAT(__test_case_, __LINE__) CONCAT(_tc_, __LINE__)(name, __FILE__, __LINE__);
  \
 void CONCAT(__test_case_, __LINE__)::_run()
 
+#define TEST_CASE_DATA_PARALLEL(name, data_path, chunks) class CONCAT(__test_case_, __LINE__) : tester::DataTestCase \
+    { \
+    public: \
+      CONCAT(__test_case_, __LINE__)(std::string tc_name, std::string file, int line): DataTestCase(tc_name, file, line, data_path, chunks) { tester::TestMonitor::register_test_case(this); } \
+    private: \
+      void _run_record(const tester::Record &record); \
+    }; \
+ \
+CONCAT(__test_case_, __LINE__) CONCAT(_tc_, __LINE__)(name, __FILE__, __LINE__); \
+ \
+void CONCAT(__test_case_, __LINE__)::_run_record(const tester::Record &record)
+
+#define TEST_CASE_DATA(name, data_path) TEST_CASE_DATA_PARALLEL(name, data_path, 1)
+
 #define PRINT(str) std::cout << tester::prefix << "#### " << str << " ####" << std::endl;
 
 #define TEST_RESULT tester::TestMonitor::any_test_failed();
@@ -793,17 +2469,38 @@ void CONCAT(__test_case_, __LINE__)::_run()
   tester::time_resters[name] = tester::TimeTester(name);\
   tester::time_resters[name].start();
 
-#define STOP_TIMER(name) tester::time_resters[name].stop();\
+#define START_TSC_TIMER(name) std::cout << tester::prefix << "Starting TSC timer \"" << name << "\" (" << __FILE__ << ":" << __LINE__ << ")" << std::endl;\
+  tester::time_resters[name] = tester::TimeTester(name, tester::ClockBackend::TSC);\
+  tester::time_resters[name].start();
+
+#define STOP_TIMER(name) { \
+    tester::ClockReading __stop_clocks = tester::read_stop_clocks(); \
+    tester::time_resters[name].stop_at(__stop_clocks); \
+  } \
   std::cout << tester::prefix << "Stopping timer \"" << name << "\"" << std::endl;\
 
 #define PRETTY_REPORT_TIMER(name) tester::time_resters[name].pretty_report();
 
 #define SIMPLE_REPORT_TIMER(name) tester::time_resters[name].simple_report();
 
+#define BENCH_WARM_COLD(name, repeats) for (tester::WarmColdBench CONCAT(__warm_cold_, __LINE__)(name, repeats); CONCAT(__warm_cold_, __LINE__).next(); )
+
+#define BENCH_WARM_COLD_EVICT(name, repeats, opts) for (tester::WarmColdBench CONCAT(__warm_cold_, __LINE__)(name, repeats, opts); CONCAT(__warm_cold_, __LINE__).next(); )
+
+#define SCOPED_TIMER(name) tester::ScopedTimer CONCAT(__scoped_timer_, __LINE__)(name);
+
+#define PRETTY_REPORT_SCOPES() tester::ScopedTimer::pretty_report();
+
+#define COLLAPSED_REPORT_SCOPES(out) tester::ScopedTimer::collapsed_report(out);
+
+#define RESET_SCOPES() tester::ScopedTimer::reset();
+
 #define SIMPLE_REPORT_ALL_TIMERS() tester::TimeTester::simple_report_all_timers();
 
-#define MAIN_RUN_ALL_TESTS() int main() \
+#define MAIN_RUN_ALL_TESTS() int main(int argc, char **argv) \
 { \
+  if (!tester::TestMonitor::parse_args(argc, argv)) \
+    return 1; \
   tester::TestMonitor::run_rests(); \
   return TEST_RESULT; \
 }
@@ -851,6 +2548,9 @@ std::cout << std::endl << "}" << std::endl;
 #undef WIDTH
 #undef TESTER_MAX_ULPS
 #undef FLOAT_PRINT_PRECISION
+#undef TESTER_TIME_REPEATS
+#undef TESTER_COMPLEXITY_MAX_RMS
+#undef TESTER_X86
 
   // }}}
 